@@ -0,0 +1,268 @@
+#ifndef LIBEXADRUMS_TESTS_FIXTURES_HPP_
+#define LIBEXADRUMS_TESTS_FIXTURES_HPP_
+
+#include "libexadrums/Api/eXaDrums.hpp"
+
+#include <string>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+#include <system_error>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+
+#if __has_include(<filesystem>)
+    #include <filesystem>
+    namespace fs = std::filesystem;
+#else
+    #include <experimental/filesystem>
+    namespace fs = std::experimental::filesystem;
+#endif
+
+namespace Fixtures
+{
+
+    /**
+     * Private copies of the user's data folder, one per test case, so that test cases
+     * don't see each other's changes and can run in parallel (one process per tag).
+     * The sound bank is read-only and is hard linked when possible, everything else
+     * (configuration files, recordings) is copied.
+     * Hard links are not copy-on-write: a test that writes to a SoundBank file in place
+     * changes the user's sample, so tests must never do that.
+     * The copies are made in $TMPDIR if it is set, or else in $HOME so that the
+     * links work, and they are all removed when the test program exits. Copies left by a
+     * program that didn't exit normally (crash, Ctrl-C) are removed by the next run.
+     */
+    class DataFolders
+    {
+
+    public:
+
+        /**
+         * Returns the data folder of a test case (with a trailing '/'), creating it on first use.
+         * It is kept across the sections of the test case, as the shared folder used to be.
+         */
+        static std::string Get(const std::string& testName)
+        {
+            auto& folders = Instance().folders;
+
+            const auto it = folders.find(testName);
+            if(it != folders.end())
+            {
+                return it->second;
+            }
+
+            const auto dataFolder = Instance().root / testName / "Data";
+            CloneDataFolder(SourceFolder(), dataFolder, false);
+
+            return folders[testName] = dataFolder.string() + "/";
+        }
+
+        /**
+         * Returns a scratch folder that lives as long as the data folders.
+         */
+        static fs::path Scratch(const std::string& name)
+        {
+            const auto path = Instance().root / name;
+            fs::create_directories(path);
+            return path;
+        }
+
+        static fs::path SourceFolder()
+        {
+            return fs::path{std::getenv("HOME")} / ".eXaDrums" / "Data";
+        }
+
+    private:
+
+        DataFolders()
+        {
+            // Hard links only work within the source's file system.
+            const auto base = std::getenv("TMPDIR") != nullptr ? fs::temp_directory_path() : fs::path{std::getenv("HOME")};
+            root = base / (prefix + std::to_string(getpid()));
+
+            RemoveStaleFolders(base);
+            fs::create_directories(root);
+        }
+
+        ~DataFolders()
+        {
+            std::error_code ec;
+            fs::remove_all(root, ec);
+        }
+
+        static DataFolders& Instance()
+        {
+            static DataFolders instance;
+            return instance;
+        }
+
+        /**
+         * Removes the folders of previous runs whose process no longer exists.
+         */
+        static void RemoveStaleFolders(const fs::path& base)
+        {
+            for(const auto& entry : fs::directory_iterator(base))
+            {
+                const auto name = entry.path().filename().string();
+                if(name.compare(0, prefix.size(), prefix) != 0)
+                {
+                    continue;
+                }
+
+                const auto pidString = name.substr(prefix.size());
+                if(pidString.empty() || pidString.find_first_not_of("0123456789") != std::string::npos)
+                {
+                    continue;
+                }
+
+                const auto pid = static_cast<pid_t>(std::stol(pidString));
+                if(kill(pid, 0) == -1 && errno == ESRCH)
+                {
+                    std::error_code ec;
+                    fs::remove_all(entry.path(), ec);
+                }
+            }
+        }
+
+        static void CloneDataFolder(const fs::path& source, const fs::path& destination, bool linkFiles)
+        {
+            fs::create_directories(destination);
+
+            for(const auto& entry : fs::directory_iterator(source))
+            {
+                const auto target = destination / entry.path().filename();
+
+                if(fs::is_directory(entry.status()))
+                {
+                    // Only the sound bank is never written to by the library.
+                    CloneDataFolder(entry.path(), target, linkFiles || entry.path().filename() == "SoundBank");
+                    continue;
+                }
+
+                // Hard links fail across file systems, copy instead.
+                std::error_code ec;
+                if(linkFiles)
+                {
+                    fs::create_hard_link(entry.path(), target, ec);
+                }
+
+                if(!linkFiles || ec)
+                {
+                    fs::copy_file(entry.path(), target);
+                }
+            }
+        }
+
+        static inline const std::string prefix = ".exadrums-tests-";
+
+        fs::path root;
+        std::map<std::string, std::string> folders;
+
+    };
+
+    /**
+     * One initialized engine per data folder, shared by all the passes of a test case
+     * instead of being constructed again for every section, and released by Clear().
+     * Call Invalidate() after changing a configuration that the engine only reads when it is
+     * constructed, the next Get() will then construct a new engine.
+     */
+    class Engines
+    {
+
+    public:
+
+        static eXaDrumsApi::eXaDrums& Get(const std::string& dataFolder)
+        {
+            auto& engines = Instance().engines;
+            auto& engine = engines[dataFolder];
+
+            if(engine.exa != nullptr && !engine.stale)
+            {
+                // Reset what tests change on a running engine.
+                if(engine.exa->IsStarted())
+                {
+                    engine.exa->Stop();
+                }
+                engine.exa->EnableRecording(false);
+
+                return *engine.exa;
+            }
+
+            engine.exa.reset();
+            engine.exa = Construct(dataFolder);
+            engine.stale = false;
+
+            return *engine.exa;
+        }
+
+        /**
+         * Constructs an engine that isn't shared, counting it in the construction time.
+         * Thread safe, so that tests can construct engines concurrently.
+         */
+        static std::unique_ptr<eXaDrumsApi::eXaDrums> Construct(const std::string& dataFolder)
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            auto exa = std::make_unique<eXaDrumsApi::eXaDrums>(dataFolder.data());
+            const auto t1 = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(Instance().statsMutex);
+            Instance().constructionTime += t1 - t0;
+            Instance().numConstructions++;
+
+            return exa;
+        }
+
+        static void Invalidate(const std::string& dataFolder)
+        {
+            auto& engines = Instance().engines;
+
+            const auto it = engines.find(dataFolder);
+            if(it != engines.end())
+            {
+                it->second.stale = true;
+            }
+        }
+
+        /**
+         * Destroys all the engines, call it when a test case ends so that the next one
+         * doesn't run alongside them.
+         */
+        static void Clear()
+        {
+            Instance().engines.clear();
+        }
+
+        static std::chrono::steady_clock::duration ConstructionTime() { return Instance().constructionTime; }
+        static std::size_t NumConstructions() { return Instance().numConstructions; }
+
+    private:
+
+        struct Engine
+        {
+            std::unique_ptr<eXaDrumsApi::eXaDrums> exa;
+            bool stale = false;
+        };
+
+        Engines() = default;
+
+        static Engines& Instance()
+        {
+            static Engines instance;
+            return instance;
+        }
+
+        std::map<std::string, Engine> engines;
+        std::mutex statsMutex;
+        std::chrono::steady_clock::duration constructionTime{};
+        std::size_t numConstructions = 0;
+
+    };
+
+}
+
+#endif /* LIBEXADRUMS_TESTS_FIXTURES_HPP_ */
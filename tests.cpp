@@ -5,19 +5,25 @@
 #include "libexadrums/Api/KitCreator/KitCreator_api.hpp"
 #include "libexadrums/Api/Config/Config_api.hpp"
 
+#include "fixtures.hpp"
+
 #include <string>
+#include <algorithm>
 #include <thread>
 #include <chrono>
 #include <memory>
+#include <future>
+#include <atomic>
+#include <utility>
+#include <vector>
+#include <numeric>
+#include <iterator>
 #include <iostream>
+#include <fstream>
+#include <cstdlib>
 
-#if __has_include(<filesystem>)
-    #include <filesystem>
-    namespace fs = std::filesystem;
-#else
-    #include <experimental/filesystem>
-    namespace fs = std::experimental::filesystem;
-#endif
+#include <sys/resource.h>
+#include <unistd.h>
 
 using namespace std::string_literals;
 using namespace std::chrono_literals;
@@ -25,6 +31,124 @@ using namespace std::this_thread;
 using namespace Catch::Matchers;
 using namespace eXaDrumsApi;
 
+// Releases each test case's engines and reports how much of the run is spent constructing them.
+struct EngineTimingListener : Catch::TestEventListenerBase
+{
+    using TestEventListenerBase::TestEventListenerBase;
+
+    void testRunStarting(const Catch::TestRunInfo& testRunInfo) override
+    {
+        TestEventListenerBase::testRunStarting(testRunInfo);
+        start = std::chrono::steady_clock::now();
+    }
+
+    void testCaseEnded(const Catch::TestCaseStats& testCaseStats) override
+    {
+        TestEventListenerBase::testCaseEnded(testCaseStats);
+
+        // Engines are shared by the sections of a test case only.
+        Fixtures::Engines::Clear();
+    }
+
+    void testRunEnded(const Catch::TestRunStats& testRunStats) override
+    {
+        TestEventListenerBase::testRunEnded(testRunStats);
+
+        using ms = std::chrono::milliseconds;
+
+        const auto runTime = std::chrono::duration_cast<ms>(std::chrono::steady_clock::now() - start);
+        const auto constructionTime = std::chrono::duration_cast<ms>(Fixtures::Engines::ConstructionTime());
+
+        std::cout << "Engine construction: " << constructionTime.count() << " ms of " << runTime.count() << " ms"
+                  << " (" << Fixtures::Engines::NumConstructions() << " engines)" << std::endl;
+    }
+
+    std::chrono::steady_clock::time_point start;
+};
+
+CATCH_REGISTER_LISTENER(EngineTimingListener)
+
+// Page faults taken by the whole process so far (minor, major).
+static std::pair<long, long> GetPageFaults()
+{
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return {usage.ru_minflt, usage.ru_majflt};
+}
+
+// Number of entries in a /proc/self directory ("task" for threads, "fd" for open files).
+static std::size_t CountProcEntries(const std::string& name)
+{
+    const auto path = fs::path{"/proc/self"} / name;
+    return std::distance(fs::directory_iterator{path}, fs::directory_iterator{});
+}
+
+// Resident set size of the process, in bytes.
+static std::size_t GetRss()
+{
+    std::size_t size = 0;
+    std::size_t resident = 0;
+    std::ifstream{"/proc/self/statm"} >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// True if the samples grow in most intervals and their least-squares slope is positive:
+// a leak rather than a one-off allocation, even if some samples drop on the way.
+template <typename T>
+static bool IsSteadyGrowth(const std::vector<T>& samples)
+{
+    const auto n = samples.size();
+    if(n < 3)
+    {
+        return false;
+    }
+
+    size_t numIncreases = 0;
+    for(size_t i = 1; i < n; ++i)
+    {
+        numIncreases += samples[i] > samples[i - 1];
+    }
+
+    const double meanX = (n - 1) / 2.;
+    const double meanY = std::accumulate(samples.begin(), samples.end(), 0.) / n;
+
+    double covariance = 0.;
+    for(size_t i = 0; i < n; ++i)
+    {
+        covariance += (i - meanX) * (samples[i] - meanY);
+    }
+
+    return covariance > 0. && numIncreases > (n - 1) / 2;
+}
+
+// Shared engine that replays the Hdd sensors data.
+static eXaDrums& GetHddEngine(const std::string& configPath)
+{
+    auto& exa = Fixtures::Engines::Get(configPath);
+    bool sensorsChanged = false;
+
+    {
+        auto config = Config(exa);
+        REQUIRE_NOTHROW( config.LoadTriggersConfig() );
+
+        if(config.GetSensorsType() != "Hdd"s)
+        {
+            REQUIRE_NOTHROW( config.SetSensorsType("Hdd"s) );
+            REQUIRE_NOTHROW( config.SaveSensorsConfig() );
+            sensorsChanged = true;
+        }
+    }
+
+    // Sensors are set up when the engine is constructed.
+    if(sensorsChanged)
+    {
+        Fixtures::Engines::Invalidate(configPath);
+        return Fixtures::Engines::Get(configPath);
+    }
+
+    return exa;
+}
+
 
 TEST_CASE("Check configuration files", "[config]")
 {
@@ -48,10 +172,10 @@ TEST_CASE("eXaDrums initialization test", "[init]")
     SECTION("Init test")
     {
 
-        const auto configPath = std::getenv("HOME")+ "/.eXaDrums/Data/"s;
+        const auto configPath = Fixtures::DataFolders::Get("init");
         INFO("Config path = " << configPath);
 
-        auto exa = eXaDrums{configPath.data()};
+        auto& exa = Fixtures::Engines::Get(configPath);
 
         const auto error = exa.GetInitError();
         const auto message = std::string{error.message};
@@ -65,8 +189,8 @@ TEST_CASE("eXaDrums initialization test", "[init]")
 TEST_CASE("eXaDrums drum kits tests", "[drumkit]") 
 {
 
-    const auto configPath = std::getenv("HOME")+ "/.eXaDrums/Data/"s;
-    auto exa = eXaDrums{configPath.data()};
+    const auto configPath = Fixtures::DataFolders::Get("drumkit");
+    auto& exa = Fixtures::Engines::Get(configPath);
 
     // Make kit creator
     std::string dataFolder(exa.GetDataLocation());
@@ -85,6 +209,9 @@ TEST_CASE("eXaDrums drum kits tests", "[drumkit]")
         REQUIRE_NOTHROW( config.SetSensorsType("Hdd"s) );
 
         REQUIRE_NOTHROW( config.SaveSensorsConfig() );
+
+        // Sensors are set up when the engine is constructed.
+        Fixtures::Engines::Invalidate(configPath);
     }
 
     int numInstruments = kitCreator->GetNumInstruments();
@@ -154,14 +281,17 @@ TEST_CASE("eXaDrums drum kits tests", "[drumkit]")
     {
         REQUIRE_NOTHROW( config.SetSensorsType("Virtual"s) );
         REQUIRE_NOTHROW( config.SaveSensorsConfig() );
+
+        // Sensors are set up when the engine is constructed.
+        Fixtures::Engines::Invalidate(configPath);
     }
 }
 
 TEST_CASE("eXaDrums recorder test", "[recorder]")
 {
 
-    const auto configPath = std::getenv("HOME")+ "/.eXaDrums/Data/"s;
-    auto exa = eXaDrums{configPath.data()};
+    const auto configPath = Fixtures::DataFolders::Get("recorder");
+    auto& exa = Fixtures::Engines::Get(configPath);
 
     // Make kit creator
     std::string dataFolder(exa.GetDataLocation());
@@ -180,6 +310,9 @@ TEST_CASE("eXaDrums recorder test", "[recorder]")
         REQUIRE_NOTHROW( config.SetSensorsType("Hdd"s) );
 
         REQUIRE_NOTHROW( config.SaveSensorsConfig() );
+
+        // Sensors are set up when the engine is constructed.
+        Fixtures::Engines::Invalidate(configPath);
     }
 
     SECTION("Recorder test")
@@ -189,10 +322,22 @@ TEST_CASE("eXaDrums recorder test", "[recorder]")
         REQUIRE_NOTHROW( exa.Start() );
         // REQUIRE_NOTHROW( exa.EnableMetronome(true) );
 
+        // Leave out the faults of Start() and Stop() (thread stacks, audio buffers, mixer setup).
+        sleep_for(200ms);
+        const auto faultsBefore = GetPageFaults();
+
         sleep_for(5s);
 
+        const auto faultsAfter = GetPageFaults();
+
         // REQUIRE_NOTHROW( exa.EnableMetronome(false) );
         REQUIRE_NOTHROW( exa.Stop() );
+
+        // Counters are per process, so they include the sensor and recorder threads as well as the audio thread.
+        WARN( "Page faults during Hdd replay: "
+              << faultsAfter.first - faultsBefore.first << " minor, "
+              << faultsAfter.second - faultsBefore.second << " major" );
+
         REQUIRE_NOTHROW( exa.EnableRecording(false) );
 
         REQUIRE_NOTHROW( exa.RecorderExport(configPath + "Rec/test.xml") );
@@ -206,18 +351,310 @@ TEST_CASE("eXaDrums recorder test", "[recorder]")
 
 }
 
-/*TEST_CASE("Import and export config tests", "[config]") 
+// Hidden until libeXaDrums guarantees several instances per process: a race would likely crash the whole run.
+TEST_CASE("Multiple eXaDrums instances", "[.][instances]")
 {
-    SECTION("test")
+
+    const auto configPath = Fixtures::DataFolders::Get("instances");
+
+    // Second, independent data folder.
+    const auto otherConfigPath = Fixtures::DataFolders::Get("instances-other");
+
+    // Construct both instances concurrently, so that shared static state shows up as a race.
+    auto makeExa = [](std::string path) { return Fixtures::Engines::Construct(path); };
+    auto exaFuture = std::async(std::launch::async, makeExa, configPath);
+    auto otherExaFuture = std::async(std::launch::async, makeExa, otherConfigPath);
+
+    auto exa = exaFuture.get();
+    auto otherExa = otherExaFuture.get();
+
+    SECTION("Init both instances")
+    {
+        REQUIRE( exa->GetInitError().type == Util::error_type_success );
+        REQUIRE( otherExa->GetInitError().type == Util::error_type_success );
+
+        CHECK( std::string{exa->GetDataLocation()} != std::string{otherExa->GetDataLocation()} );
+    }
+
+    SECTION("Kits are not shared")
+    {
+        const auto nbKits = exa->GetKitsNames().size();
+        REQUIRE( otherExa->GetKitsNames().size() == nbKits );
+        REQUIRE( nbKits > 1 );
+
+        REQUIRE_NOTHROW( otherExa->DeleteKit(nbKits - 1) );
+        REQUIRE_NOTHROW( otherExa->ReloadKits() );
+        REQUIRE_NOTHROW( exa->ReloadKits() );
+
+        CHECK( otherExa->GetKitsNames().size() == nbKits - 1 );
+        CHECK( exa->GetKitsNames().size() == nbKits );
+    }
+
+    SECTION("Run both instances")
+    {
+        REQUIRE_NOTHROW( exa->Start() );
+        REQUIRE_NOTHROW( otherExa->Start() );
+
+        sleep_for(2s);
+
+        REQUIRE_NOTHROW( otherExa->Stop() );
+        REQUIRE_NOTHROW( exa->Stop() );
+    }
+}
+
+TEST_CASE("Kit switching benchmark", "[.][benchmark]")
+{
+
+    const auto configPath = Fixtures::DataFolders::Get("kitswitch");
+    auto& exa = GetHddEngine(configPath);
+
+    const auto kitsNames = exa.GetKitsNames();
+    REQUIRE( kitsNames.size() > 1 );
+
+    REQUIRE_NOTHROW( exa.Start() );
+
+    // How long SelectKit() blocks the calling thread, which says nothing about gaps in the audio output.
+    auto longestSwitch = 0us;
+    for(size_t i = 0; i < kitsNames.size(); ++i)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        REQUIRE_NOTHROW( exa.SelectKit(i) );
+        const auto t1 = std::chrono::steady_clock::now();
+
+        longestSwitch = std::max(longestSwitch, std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0));
+
+        sleep_for(500ms);
+    }
+
+    REQUIRE_NOTHROW( exa.SelectKit(0) );
+    REQUIRE_NOTHROW( exa.Stop() );
+
+    WARN( "Longest SelectKit() call while playing: " << longestSwitch.count() << " us" );
+}
+
+TEST_CASE("Start/Stop latency benchmark", "[.][benchmark]")
+{
+
+    const auto configPath = Fixtures::DataFolders::Get("startstop");
+    auto& exa = Fixtures::Engines::Get(configPath);
+
+    const size_t numCycles = 200;
+
+    // The first cycle opens what the following ones are expected to reuse.
+    REQUIRE_NOTHROW( exa.Start() );
+    REQUIRE_NOTHROW( exa.Stop() );
+
+    const auto numThreads = CountProcEntries("task");
+    const auto numFds = CountProcEntries("fd");
+
+    std::vector<std::chrono::microseconds> startTimes;
+    std::vector<std::chrono::microseconds> stopTimes;
+
+    for(size_t i = 0; i < numCycles; ++i)
+    {
+        const auto t0 = std::chrono::steady_clock::now();
+        exa.Start();
+        const auto t1 = std::chrono::steady_clock::now();
+        exa.Stop();
+        const auto t2 = std::chrono::steady_clock::now();
+
+        startTimes.push_back(std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0));
+        stopTimes.push_back(std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1));
+    }
+
+    const auto report = [&](const std::string& name, std::vector<std::chrono::microseconds> times)
+    {
+        std::sort(times.begin(), times.end());
+        const auto mean = std::accumulate(times.begin(), times.end(), 0us) / times.size();
+
+        WARN( name << " over " << numCycles << " cycles: mean " << mean.count() << " us, median "
+              << times[times.size() / 2].count() << " us, p99 " << times[times.size() * 99 / 100].count()
+              << " us, max " << times.back().count() << " us" );
+    };
+
+    report("Start()", startTimes);
+    report("Stop()", stopTimes);
+
+    CHECK( CountProcEntries("task") == numThreads );
+    CHECK( CountProcEntries("fd") == numFds );
+}
+
+TEST_CASE("UI polling stress test", "[.][stress]")
+{
+
+    const auto configPath = Fixtures::DataFolders::Get("stress");
+
+    auto& exa = GetHddEngine(configPath);
+
+    std::atomic<bool> polling{true};
+    std::vector<std::chrono::nanoseconds> pollTimes;
+    pollTimes.reserve(10000);
+    size_t numHits = 0;
+
+    // Poll the trigger meters at 1 kHz, as the UI would, while the engine replays the Hdd data.
+    auto poller = std::thread([&]
+    {
+        auto lastTrigTime = exa.GetLastTrigTime();
+        auto next = std::chrono::steady_clock::now();
+
+        while(polling.load())
+        {
+            const auto t0 = std::chrono::steady_clock::now();
+            const auto trigTime = exa.GetLastTrigTime();
+            const auto trigValue = exa.GetLastTrigValue();
+            const auto t1 = std::chrono::steady_clock::now();
+
+            pollTimes.push_back(t1 - t0);
+            numHits += trigTime != lastTrigTime && trigValue > 0;
+            lastTrigTime = trigTime;
+
+            next += 1ms;
+            sleep_until(next);
+        }
+    });
+
+    // Don't leave the poller running if the engine throws.
+    CHECK_NOTHROW( exa.Start() );
+    sleep_for(5s);
+    CHECK_NOTHROW( exa.Stop() );
+
+    polling.store(false);
+    poller.join();
+
+    REQUIRE( pollTimes.size() > 0 );
+    std::sort(pollTimes.begin(), pollTimes.end());
+
+    using us = std::chrono::microseconds;
+    const auto p99 = std::chrono::duration_cast<us>(pollTimes[pollTimes.size() * 99 / 100]);
+    const auto max = std::chrono::duration_cast<us>(pollTimes.back());
+
+    WARN( pollTimes.size() << " polls, " << numHits << " hits seen, p99 " << p99.count() << " us, max " << max.count() << " us" );
+
+    // A getter that waits on the realtime threads' locks shows up as a slow poll.
+    CHECK( p99 < 1ms );
+}
+
+TEST_CASE("Soak test", "[.][soak]")
+{
+
+    // Duration in minutes, set EXADRUMS_SOAK_MINUTES to run for hours.
+    const auto minutesEnv = std::getenv("EXADRUMS_SOAK_MINUTES");
+    const size_t numMinutes = minutesEnv != nullptr ? std::stoul(minutesEnv) : 60;
+    const size_t reloadPeriod = 5;
+
+    // The first reload cycle is warm-up, at least three more are needed to see a trend.
+    const size_t warmupCycles = 1;
+    REQUIRE( numMinutes / reloadPeriod >= warmupCycles + 3 );
+
+    const auto configPath = Fixtures::DataFolders::Get("soak");
+    const auto recPath = Fixtures::DataFolders::Scratch("soak-rec");
+
+    auto& exa = GetHddEngine(configPath);
+
+    // Sampled at the same point of each reload cycle: after the minute of playback that follows
+    // the kits reload, which never records, so that recorder buffers don't show up in half the samples.
+    std::vector<std::size_t> rss;
+    std::vector<std::size_t> fds;
+    std::vector<std::size_t> threads;
+
+    for(size_t minute = 0; minute < numMinutes; ++minute)
+    {
+        const bool reload = minute % reloadPeriod == reloadPeriod - 1;
+        const bool record = !reload && minute % reloadPeriod % 2 == 1;
+
+        if(reload)
+        {
+            REQUIRE_NOTHROW( exa.ReloadKits() );
+        }
+
+        // Restarting the engine replays the Hdd sensors data from the start.
+        REQUIRE_NOTHROW( exa.EnableRecording(record) );
+        REQUIRE_NOTHROW( exa.Start() );
+
+        sleep_for(1min);
+
+        REQUIRE_NOTHROW( exa.Stop() );
+
+        if(record)
+        {
+            REQUIRE_NOTHROW( exa.EnableRecording(false) );
+            REQUIRE_NOTHROW( exa.RecorderExportPCM((recPath / "soak.wav").string()) );
+        }
+
+        const auto minuteRss = GetRss();
+        const auto minuteFds = CountProcEntries("fd");
+        const auto minuteThreads = CountProcEntries("task");
+
+        std::cout << "Soak minute " << minute + 1 << "/" << numMinutes << ": RSS " << minuteRss / 1024 << " KiB, "
+                  << minuteFds << " fds, " << minuteThreads << " threads" << std::endl;
+
+        if(reload && minute / reloadPeriod >= warmupCycles)
+        {
+            rss.push_back(minuteRss);
+            fds.push_back(minuteFds);
+            threads.push_back(minuteThreads);
+        }
+    }
+
+    CHECK_FALSE( IsSteadyGrowth(rss) );
+    CHECK_FALSE( IsSteadyGrowth(fds) );
+    CHECK_FALSE( IsSteadyGrowth(threads) );
+}
+
+TEST_CASE("Import and export config tests", "[config]") 
+{
+    SECTION("Export and import config")
     {
         const auto home = std::getenv("HOME");
-        const auto configPath = home + "/.eXaDrums/Data/"s;
-        auto exa = eXaDrums{configPath.data()};
+        const auto scratchPath = Fixtures::DataFolders::Scratch("config");
+        const auto zipFile = (scratchPath / "test.zip").string();
+        const auto importPath = (scratchPath / "test_config").string();
+
+        REQUIRE_NOTHROW( Config::ExportConfig(home + "/.eXaDrums"s, zipFile) );
+        REQUIRE( fs::exists(zipFile) );
+
+        REQUIRE_NOTHROW( Config::ImportConfig(zipFile, importPath) );
+        REQUIRE( fs::exists(importPath) );
+        CHECK_FALSE( fs::is_empty(importPath) );
+    }
+}
+
+TEST_CASE("Import and export config benchmark", "[.][benchmark]")
+{
+    const auto home = std::getenv("HOME");
+    // Scratch folders are in $TMPDIR or $HOME, not in tmpfs: the disk I/O is part of what is measured.
+    const auto benchPath = Fixtures::DataFolders::Scratch("benchmark");
+    const auto configPath = benchPath / ".eXaDrums";
+    const auto zipFile = (benchPath / "bench.zip").string();
+    const auto importPath = benchPath / "imported";
+
+    // Hundreds of samples, as in a full sample library.
+    const size_t numSamples = 500;
 
-        //Config::ExportConfig(home + "/.eXaDrums"s, "./test.zip");
-        //Config::ImportConfig("test.zip", "test_config");
+    fs::copy(home + "/.eXaDrums"s, configPath, fs::copy_options::recursive);
 
-        //fs::remove("test.zip");
-        fs::remove_all("test_config");
+    const auto sample = configPath / "Data/SoundBank/SnareDrum/Snr_Acou_01.wav";
+    REQUIRE( fs::exists(sample) );
+
+    const auto samplesPath = configPath / "Data/SoundBank/Bench";
+    fs::create_directories(samplesPath);
+    for(size_t i = 0; i < numSamples; ++i)
+    {
+        fs::copy_file(sample, samplesPath / ("Sample_" + std::to_string(i) + ".wav"));
+    }
+
+    BENCHMARK("Export config with " + std::to_string(numSamples) + " samples")
+    {
+        Config::ExportConfig(configPath.string(), zipFile);
     }
-}*/
\ No newline at end of file
+
+    REQUIRE( fs::exists(zipFile) );
+
+    BENCHMARK("Import config with " + std::to_string(numSamples) + " samples")
+    {
+        fs::remove_all(importPath);
+        Config::ImportConfig(zipFile, importPath.string());
+    }
+
+    CHECK( fs::exists(importPath) );
+}